@@ -0,0 +1,426 @@
+#include <cerrno>
+#include <system_error>
+#include <thread>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Reactor.hpp"
+
+// Maximum number of ready events handled per call to epoll_wait.
+static const int MAX_EVENTS = 64;
+
+/**
+ * Constructor that remembers which reactor (if any) will wake this operation
+ * and what kind of readiness it waits for.
+ *
+ * @param reactor The event loop to wait on, or NULL to wait on this thread.
+ * @param fd The file descriptor the operation works on.
+ * @param events The epoll events (EPOLLIN or EPOLLOUT) to wait for.
+ */
+IoOp::IoOp(Reactor *reactor, int fd, uint32_t events)
+	: fd(fd), events(events), error(0), reactor(reactor) {
+}
+
+/**
+ * Tries the operation right away so that no suspension is needed when the
+ * socket already has data (or buffer space) available.
+ *
+ * @return true if the operation finished, false if the coroutine must suspend.
+ */
+bool IoOp::await_ready()
+{
+	while (!perform())
+	{
+		if (reactor != NULL)
+			return false;
+
+		// Nobody else will wake us up, so wait for fd right here.
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = (events & EPOLLIN) ? POLLIN : POLLOUT;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+			error = errno;
+			return true;
+		}
+	}
+	return true;
+}
+
+/**
+ * Parks the coroutine until the reactor sees fd become ready.
+ *
+ * @param h The suspended coroutine.
+ */
+void IoOp::await_suspend(std::coroutine_handle<> h)
+{
+	handle = h;
+	reactor->watch(this);
+}
+
+/**
+ * Continues the operation after the reactor saw fd become ready. The
+ * coroutine is only resumed once the whole operation is done.
+ */
+void IoOp::onReady()
+{
+	if (perform()) {
+		handle.resume();
+		return;
+	}
+	try {
+		reactor->watch(this);
+	}
+	catch (const std::system_error &e) {
+		// Let the coroutine deal with it rather than killing the event loop.
+		error = e.code().value();
+		handle.resume();
+	}
+}
+
+/**
+ * Throws an exception if the operation failed.
+ *
+ * @param what Description of the operation used in the exception message.
+ */
+void IoOp::check(const char *what)
+{
+	if (error != 0) {
+		std::error_code ec(error, std::generic_category());
+		throw std::system_error(ec, what);
+	}
+}
+
+RecvOp::RecvOp(Reactor *reactor, int fd, char *dest, size_t buff_size)
+	: IoOp(reactor, fd, EPOLLIN), dest(dest), buff_size(buff_size), received(0) {
+}
+
+bool RecvOp::perform()
+{
+	while (true)
+	{
+		ssize_t num_bytes_received = recv(fd, dest, buff_size, 0);
+		if (num_bytes_received >= 0) {
+			received = num_bytes_received;
+			return true;
+		}
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return false;
+		if (errno != EINTR) {
+			error = errno;
+			return true;
+		}
+	}
+}
+
+/**
+ * @return The number of bytes received and written to the destination buffer.
+ */
+size_t RecvOp::await_resume()
+{
+	check("recv failed");
+	return received;
+}
+
+SendOp::SendOp(Reactor *reactor, int fd, const char *data, size_t data_length)
+	: IoOp(reactor, fd, EPOLLOUT), data(data), num_bytes_remaining(data_length) {
+}
+
+bool SendOp::perform()
+{
+	while (num_bytes_remaining > 0)
+	{
+		// MSG_NOSIGNAL: a client hanging up should be an error, not a SIGPIPE
+		ssize_t num_bytes_sent = send(fd, data, num_bytes_remaining, MSG_NOSIGNAL);
+		if (num_bytes_sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return false;
+			if (errno == EINTR)
+				continue;
+			error = errno;
+			return true;
+		}
+		data += num_bytes_sent;
+		num_bytes_remaining -= num_bytes_sent;
+	}
+	return true;
+}
+
+void SendOp::await_resume()
+{
+	check("send failed");
+}
+
+SendfileOp::SendfileOp(Reactor *reactor, int out_fd, int in_fd, off_t offset, size_t count)
+	: IoOp(reactor, out_fd, EPOLLOUT), in_fd(in_fd), offset(offset), num_bytes_remaining(count) {
+}
+
+bool SendfileOp::perform()
+{
+	while (num_bytes_remaining > 0)
+	{
+		// sendfile advances offset itself
+		ssize_t num_bytes_sent = sendfile(fd, in_fd, &offset, num_bytes_remaining);
+		if (num_bytes_sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return false;
+			if (errno == EINTR)
+				continue;
+			error = errno;
+			return true;
+		}
+		if (num_bytes_sent == 0) {
+			// The file got shorter since we looked at its size.
+			error = EIO;
+			return true;
+		}
+		num_bytes_remaining -= num_bytes_sent;
+	}
+	return true;
+}
+
+void SendfileOp::await_resume()
+{
+	check("sendfile failed");
+}
+
+AcceptOp::AcceptOp(Reactor *reactor, int server_sock, size_t max_batch)
+	: IoOp(reactor, server_sock, EPOLLIN), max_batch(max_batch) {
+}
+
+bool AcceptOp::perform()
+{
+	while (client_socks.size() < max_batch)
+	{
+		int client_sock = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (client_sock >= 0) {
+			client_socks.push_back(client_sock);
+			continue;
+		}
+		if (errno == EINTR)
+			continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return !client_socks.empty();
+
+		// Only report the error if we have nothing else to hand back; if it
+		// is still there, the next accept will run into it again.
+		if (client_socks.empty())
+			error = errno;
+		return true;
+	}
+	return true;
+}
+
+/**
+ * Only accepts right away when there is no reactor. Otherwise the coroutine
+ * waits for the next turn of the event loop, even if connections are already
+ * waiting, so a steady stream of new clients can't starve the ones already
+ * being served.
+ *
+ * @return true if the operation finished, false if the coroutine must suspend.
+ */
+bool AcceptOp::await_ready()
+{
+	if (reactor != NULL)
+		return false;
+	return IoOp::await_ready();
+}
+
+/**
+ * @return The socket descriptors for the newly accepted connections (at
+ * least one).
+ */
+std::vector<int> AcceptOp::await_resume()
+{
+	check("accept failed");
+	return std::move(client_socks);
+}
+
+SleepOp::SleepOp(Reactor *reactor, std::chrono::milliseconds duration)
+	: reactor(reactor), duration(duration) {
+}
+
+bool SleepOp::await_ready()
+{
+	return duration.count() <= 0;
+}
+
+/**
+ * Without a reactor we are on our own thread and can simply block.
+ *
+ * @return true if the coroutine stays suspended until the timer fires.
+ */
+bool SleepOp::await_suspend(std::coroutine_handle<> h)
+{
+	if (reactor == NULL) {
+		std::this_thread::sleep_for(duration);
+		return false;
+	}
+	reactor->addTimer(std::chrono::steady_clock::now() + duration, h);
+	return true;
+}
+
+/**
+ * Receives data over the given socket. co_await the result to get the
+ * number of bytes received.
+ *
+ * @param reactor The event loop to wait on, or NULL to wait on this thread.
+ * @param fd The socket to receive data from.
+ * @param dest The buffer where we will store the received data.
+ * @param buff_size Number of bytes in the buffer.
+ */
+RecvOp async_recv(Reactor *reactor, int fd, char *dest, size_t buff_size)
+{
+	return RecvOp(reactor, fd, dest, buff_size);
+}
+
+/**
+ * Sends all of the given data over the given socket.
+ *
+ * @param reactor The event loop to wait on, or NULL to wait on this thread.
+ * @param fd The socket to send data over.
+ * @param data The data to send.
+ * @param data_length Number of bytes of data to send.
+ */
+SendOp async_send(Reactor *reactor, int fd, const char *data, size_t data_length)
+{
+	return SendOp(reactor, fd, data, data_length);
+}
+
+/**
+ * Sends part of a file over the given socket without copying it through
+ * user space.
+ *
+ * @param reactor The event loop to wait on, or NULL to wait on this thread.
+ * @param out_fd The socket to send the file over.
+ * @param in_fd The open file to send.
+ * @param offset Where in the file to start.
+ * @param count Number of bytes of the file to send.
+ */
+SendfileOp async_sendfile(Reactor *reactor, int out_fd, int in_fd, off_t offset, size_t count)
+{
+	return SendfileOp(reactor, out_fd, in_fd, offset, count);
+}
+
+/**
+ * Accepts the connections waiting on a listening socket, up to max_batch at
+ * a time.
+ *
+ * @param reactor The event loop to wait on, or NULL to wait on this thread.
+ * @param server_sock The (non-blocking) listening socket.
+ * @param max_batch The most connections to accept in one go.
+ */
+AcceptOp async_accept(Reactor *reactor, int server_sock, size_t max_batch)
+{
+	return AcceptOp(reactor, server_sock, max_batch);
+}
+
+/**
+ * Suspends the calling coroutine for (at least) the given duration.
+ *
+ * @param reactor The event loop that owns the timer, or NULL to block.
+ * @param duration How long to sleep.
+ */
+SleepOp sleep_for(Reactor *reactor, std::chrono::milliseconds duration)
+{
+	return SleepOp(reactor, duration);
+}
+
+/**
+ * Constructor that creates the epoll instance used to wait for readiness.
+ */
+Reactor::Reactor() {
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		std::error_code ec(errno, std::generic_category());
+		throw std::system_error(ec, "epoll_create1 failed");
+	}
+}
+
+Reactor::~Reactor() {
+	close(epoll_fd);
+}
+
+/**
+ * Asks to be told (once) when the operation's descriptor becomes ready.
+ * Each descriptor has at most one pending operation, so the operation itself
+ * is stored as the event's user data.
+ *
+ * @param op The operation to continue when its descriptor is ready.
+ */
+void Reactor::watch(IoOp *op)
+{
+	struct epoll_event ev;
+	ev.events = op->events | EPOLLONESHOT;
+	ev.data.ptr = op;
+
+	// Descriptors stay registered (but disarmed) after a one-shot event, so
+	// re-arming is the common case; new descriptors need to be added first.
+	int retval = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, op->fd, &ev);
+	if (retval < 0 && errno == ENOENT)
+		retval = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, op->fd, &ev);
+	if (retval < 0) {
+		std::error_code ec(errno, std::generic_category());
+		throw std::system_error(ec, "epoll_ctl failed");
+	}
+}
+
+/**
+ * Schedules a coroutine to be resumed at the given time.
+ *
+ * @param when The time at which to resume.
+ * @param h The suspended coroutine.
+ */
+void Reactor::addTimer(std::chrono::steady_clock::time_point when, std::coroutine_handle<> h)
+{
+	timers.push(Timer(when, h));
+}
+
+/**
+ * Resumes every coroutine whose timer has expired.
+ *
+ * @return Milliseconds until the next timer expires, or -1 if there is none.
+ */
+int Reactor::runExpiredTimers()
+{
+	while (!timers.empty())
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		Timer next = timers.top();
+		if (next.first > now) {
+			// round up so we don't wake up just before the deadline
+			return std::chrono::ceil<std::chrono::milliseconds>(next.first - now).count();
+		}
+		timers.pop();
+		next.second.resume();
+	}
+	return -1;
+}
+
+/**
+ * Sit around forever waiting for descriptors and timers to become ready and
+ * resuming the coroutines waiting on them.
+ */
+void Reactor::run()
+{
+	struct epoll_event events[MAX_EVENTS];
+	while (true)
+	{
+		int timeout = runExpiredTimers();
+		int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+		if (num_events < 0) {
+			if (errno == EINTR)
+				continue;
+			std::error_code ec(errno, std::generic_category());
+			throw std::system_error(ec, "epoll_wait failed");
+		}
+		for (int i = 0; i < num_events; i++)
+		{
+			static_cast<IoOp*>(events[i].data.ptr)->onReady();
+		}
+	}
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <queue>
+#include <vector>
+#include <sys/types.h>
+
+class Reactor;
+
+/**
+ * Return type for a fire-and-forget coroutine (e.g. one per connection).
+ * The coroutine starts running as soon as it is called and its frame frees
+ * itself when it finishes, so the caller never has to hold on to it.
+ *
+ * @note Exceptions may not escape a Task; catch them inside the coroutine.
+ */
+struct Task {
+	struct promise_type {
+		Task get_return_object() { return Task(); }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+/**
+ * Base class for an awaitable socket operation. The operation is first tried
+ * right away; only if it would block does the coroutine suspend and ask the
+ * reactor to resume it once the file descriptor is ready.
+ *
+ * When there is no reactor (i.e. reactor is NULL) the calling thread waits
+ * for the descriptor itself, so the operation always finishes without
+ * suspending. This lets the same coroutine run straight through on a worker
+ * thread.
+ */
+class IoOp {
+  public:
+	  IoOp(Reactor *reactor, int fd, uint32_t events);
+	  virtual ~IoOp() = default;
+
+	  bool await_ready();
+	  void await_suspend(std::coroutine_handle<> h);
+
+	  // called by the reactor when fd is ready for this operation
+	  void onReady();
+
+	  int fd;
+	  uint32_t events;
+
+  protected:
+	  // Makes as much progress as possible. Returns true once the operation
+	  // has finished (successfully or with error set), false if it would block.
+	  virtual bool perform() = 0;
+
+	  // Throws a std::system_error if the operation failed.
+	  void check(const char *what);
+
+	  int error;
+	  Reactor *reactor;
+
+  private:
+	  std::coroutine_handle<> handle;
+};
+
+/**
+ * Awaitable recv(): resumes with the number of bytes received (0 at EOF).
+ */
+class RecvOp : public IoOp {
+  public:
+	  RecvOp(Reactor *reactor, int fd, char *dest, size_t buff_size);
+	  size_t await_resume();
+
+  protected:
+	  bool perform() override;
+
+  private:
+	  char *dest;
+	  size_t buff_size;
+	  size_t received;
+};
+
+/**
+ * Awaitable send(): resumes once every byte has been sent.
+ */
+class SendOp : public IoOp {
+  public:
+	  SendOp(Reactor *reactor, int fd, const char *data, size_t data_length);
+	  void await_resume();
+
+  protected:
+	  bool perform() override;
+
+  private:
+	  const char *data;
+	  size_t num_bytes_remaining;
+};
+
+/**
+ * Awaitable sendfile(): resumes once count bytes of in_fd have been sent.
+ */
+class SendfileOp : public IoOp {
+  public:
+	  SendfileOp(Reactor *reactor, int out_fd, int in_fd, off_t offset, size_t count);
+	  void await_resume();
+
+  protected:
+	  bool perform() override;
+
+  private:
+	  int in_fd;
+	  off_t offset;
+	  size_t num_bytes_remaining;
+};
+
+/**
+ * Awaitable accept4(): drains up to max_batch pending connections at once and
+ * resumes with their (non-blocking, close-on-exec) socket descriptors.
+ *
+ * Unlike the other operations, with a reactor this always suspends first, so
+ * an accept loop gives every other ready connection a turn between batches.
+ */
+class AcceptOp : public IoOp {
+  public:
+	  AcceptOp(Reactor *reactor, int server_sock, size_t max_batch);
+	  bool await_ready();
+	  std::vector<int> await_resume();
+
+  protected:
+	  bool perform() override;
+
+  private:
+	  size_t max_batch;
+	  std::vector<int> client_socks;
+};
+
+/**
+ * Awaitable timer: resumes after the given duration has passed.
+ */
+class SleepOp {
+  public:
+	  SleepOp(Reactor *reactor, std::chrono::milliseconds duration);
+
+	  bool await_ready();
+	  bool await_suspend(std::coroutine_handle<> h);
+	  void await_resume() {}
+
+  private:
+	  Reactor *reactor;
+	  std::chrono::milliseconds duration;
+};
+
+RecvOp async_recv(Reactor *reactor, int fd, char *dest, size_t buff_size);
+SendOp async_send(Reactor *reactor, int fd, const char *data, size_t data_length);
+SendfileOp async_sendfile(Reactor *reactor, int out_fd, int in_fd, off_t offset, size_t count);
+AcceptOp async_accept(Reactor *reactor, int server_sock, size_t max_batch);
+SleepOp sleep_for(Reactor *reactor, std::chrono::milliseconds duration);
+
+/**
+ * Class representing a single-threaded, readiness-based (epoll) event loop
+ * that resumes suspended coroutines when their sockets or timers are ready.
+ */
+class Reactor {
+  public:
+	  Reactor();
+	  ~Reactor();
+
+	  // public member functions (a.k.a. methods)
+	  void run();
+	  void watch(IoOp *op);
+	  void addTimer(std::chrono::steady_clock::time_point when, std::coroutine_handle<> h);
+
+  private:
+	  typedef std::pair<std::chrono::steady_clock::time_point, std::coroutine_handle<>> Timer;
+
+	  struct TimerLater {
+		  bool operator()(const Timer &a, const Timer &b) const { return a.first > b.first; }
+	  };
+
+	  int runExpiredTimers();
+
+	  int epoll_fd;
+	  std::priority_queue<Timer, std::vector<Timer>, TimerLater> timers;
+};
@@ -0,0 +1,173 @@
+/*
+ * A small load generator for ToreroServe.
+ *
+ * This program should take four arguments:
+ * 	1. The port number the server is listening on (on this machine)
+ * 	2. The path to request, e.g. /index.html
+ * 	3. The number of clients to run at the same time
+ * 	4. How many seconds to run for
+ * and optionally a fifth:
+ * 	5. The path of a large file to download over and over while the clients
+ * 	   run, to see whether big transfers still make progress under load.
+ *
+ * Each client is a thread that repeatedly connects, sends a GET request,
+ * reads the response until the server closes the connection, and starts
+ * over. At the end the total throughput and average latency are printed,
+ * along with the average time per large download if one was given.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::cout;
+using std::string;
+using std::vector;
+using std::thread;
+
+// Totals shared by all client threads.
+static std::atomic<long> completed(0);
+static std::atomic<long> failed(0);
+static std::atomic<long> total_latency_us(0);
+
+// Totals for the large file downloads (only touched by one thread).
+static long large_completed = 0;
+static long large_failed = 0;
+static long large_total_us = 0;
+
+/**
+ * Sends a single request and reads the whole response.
+ *
+ * @param port The port the server is listening on.
+ * @param request The full HTTP request to send.
+ * @return true if a non-empty response was received.
+ */
+bool doRequest(int port, const string &request)
+{
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0)
+		return false;
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+			send(sock, request.data(), request.length(), MSG_NOSIGNAL) != (ssize_t)request.length()) {
+		close(sock);
+		return false;
+	}
+
+	char buffer[4096];
+	long total = 0;
+	ssize_t num_bytes;
+	while ((num_bytes = recv(sock, buffer, sizeof(buffer), 0)) > 0)
+		total += num_bytes;
+
+	close(sock);
+	return num_bytes == 0 && total > 0;
+}
+
+/**
+ * Function that each client thread runs until the deadline passes.
+ *
+ * @param port The port the server is listening on.
+ * @param request The full HTTP request to send.
+ * @param deadline When to stop sending requests.
+ */
+void client(int port, string request, std::chrono::steady_clock::time_point deadline)
+{
+	while (std::chrono::steady_clock::now() < deadline)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool ok = doRequest(port, request);
+		std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+
+		if (ok) {
+			completed++;
+			total_latency_us += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+		}
+		else {
+			failed++;
+		}
+	}
+}
+
+/**
+ * Function that the large file thread runs until the deadline passes. A
+ * download still running at the deadline is allowed to finish so that a
+ * stalled transfer shows up as a long time rather than not at all.
+ *
+ * @param port The port the server is listening on.
+ * @param request The full HTTP request for the large file.
+ * @param deadline When to stop starting new downloads.
+ */
+void largeClient(int port, string request, std::chrono::steady_clock::time_point deadline)
+{
+	while (std::chrono::steady_clock::now() < deadline)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool ok = doRequest(port, request);
+		std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+
+		if (ok) {
+			large_completed++;
+			large_total_us += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+		}
+		else {
+			large_failed++;
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc != 5 && argc != 6) {
+		fprintf(stderr, "usage: %s <port> <path> <clients> <seconds> [large path]\n", argv[0]);
+		exit(1);
+	}
+	int port = std::stoi(argv[1]);
+	string request = string("GET ") + argv[2] + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+	int num_clients = std::stoi(argv[3]);
+	int seconds = std::stoi(argv[4]);
+
+	std::chrono::steady_clock::time_point deadline =
+		std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+
+	vector<thread> clients;
+	for (int i = 0; i < num_clients; i++)
+		clients.push_back(thread(client, port, request, deadline));
+	if (argc == 6) {
+		string large_request = string("GET ") + argv[5] + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+		clients.push_back(thread(largeClient, port, large_request, deadline));
+	}
+	for (thread &t : clients)
+		t.join();
+
+	long done = completed.load();
+	cout << "requests:    " << done << " ok, " << failed.load() << " failed\n";
+	cout << "throughput:  " << (double)done / seconds << " req/s\n";
+	if (done > 0)
+		cout << "avg latency: " << (double)total_latency_us.load() / done / 1000 << " ms\n";
+	if (argc == 6) {
+		cout << "large file:  " << large_completed << " ok, " << large_failed << " failed";
+		if (large_completed > 0)
+			cout << ", avg " << (double)large_total_us / large_completed / 1000 << " ms each";
+		cout << "\n";
+	}
+
+	return 0;
+}
@@ -5,6 +5,13 @@
  * This program should take two arguments:
  * 	1. The port number on which to bind and listen for connections
  * 	2. The directory out of which to serve files.
+ * and optionally a third:
+ * 	3. "coro" (default) or "pool", how connections are handled.
+ *
+ * Options for tuning the listening socket may come before or after these:
+ * 	-b <backlog>	How many connections may wait to be accepted.
+ * 	-f <qlen>	Enable TCP_FASTOPEN with the given queue length.
+ * 	-n		Enable TCP_NODELAY on client connections.
  *	
  *	Description:
  *	This program runs a lean web server that delivers pages from a directory
@@ -19,9 +26,12 @@
 #include <cstdlib>
 #include <cstring>
 #include <cerrno>
+#include <csignal>
 
 // operating system specific libraries
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -44,6 +54,7 @@
 #include <thread>
 #include <pthread.h>
 #include "BoundedBuffer.hpp"
+#include "Reactor.hpp"
 namespace fs = boost::filesystem;
 
 using std::cout;
@@ -51,88 +62,118 @@ using std::string;
 using std::vector;
 using std::thread;
 
-// This will limit how many clients can be waiting for a connection.
-static const int BACKLOG = 10;
+// This will limit how many clients can be waiting for a connection, unless
+// changed with -b. The kernel caps it at net.core.somaxconn.
+static const int DEFAULT_BACKLOG = 4096;
 static const int bufferSize = 2048;
 
+// Number of worker threads in "pool" mode.
+static const int NUM_WORKERS = 10;
+
+// Most connections accepted in one go before handing them off. In "coro"
+// mode this is also the most accepted per turn of the event loop.
+static const size_t ACCEPT_BATCH = 64;
+
+// How long the kernel holds on to a connection that hasn't sent anything
+// yet before handing it to us anyway (TCP_DEFER_ACCEPT).
+static const int DEFER_ACCEPT_SECONDS = 5;
+
+// How long to wait before accepting again when the kernel is out of memory.
+static const std::chrono::milliseconds ACCEPT_BACKOFF(100);
+
+/**
+ * Tunables for the listening socket and the connections accepted on it.
+ */
+struct ListenOptions {
+	int backlog = DEFAULT_BACKLOG;
+	int fastopen_qlen = 0; // 0 leaves TCP_FASTOPEN off
+	bool nodelay = false;
+};
+
+// A spare file descriptor, given up when we run out so that we can still
+// accept (and drop) connections instead of spinning on EMFILE.
+static int reserve_fd = -1;
+
 // forward declarations
-void sendData(int socked_fd, const char *data, size_t data_length);
-int receiveData(int socked_fd, char *dest, size_t buff_size);
 std::string dateToString (void);
-void sendFileNotFound (const int client_sock, std::string httpTypeResponse);
-void sendBadRequest (const int client_sock);
-void sendOK (const int client_sock, int size, fs::path extension, std::vector<char> s, std::string content);
+std::string fileNotFoundResponse (std::string httpTypeResponse);
+std::string badRequestResponse (void);
+std::string okHeader (size_t size, fs::path extension);
 std::string generateIndexHTML(fs::path directory);
 int containsIndex(fs::path directory);
-void handleClient(BoundedBuffer &buff, char* parent_directory);
-int createSocketAndListen(const int port_num);
-void acceptConnections(const int server_sock, char* parent_directory); 
+Task handleClient(Reactor *reactor, int client_sock, char *parent_directory);
+void handleClients(BoundedBuffer &buff, char *parent_directory);
+int createSocketAndListen(const int port_num, const ListenOptions &options);
+bool shedConnection(const int server_sock);
+Task acceptConnections(Reactor *reactor, BoundedBuffer *buffer, const int server_sock, ListenOptions options, char *parent_directory);
+void runPool(const int server_sock, const ListenOptions &options, char *parent_directory);
+void runReactor(const int server_sock, const ListenOptions &options, char *parent_directory);
 
 
 int main(int argc, char** argv) {
 
+	/* Read the options for the listening socket. */
+	ListenOptions options;
+	int opt;
+	while ((opt = getopt(argc, argv, "b:f:n")) != -1) {
+		switch (opt) {
+			case 'b':
+				options.backlog = std::atoi(optarg);
+				break;
+			case 'f':
+				options.fastopen_qlen = std::atoi(optarg);
+				break;
+			case 'n':
+				options.nodelay = true;
+				break;
+			default:
+				fprintf(stderr, "INCORRECT USAGE!\n");
+				exit(1);
+		}
+	}
+	char **args = argv + optind;
+	int num_args = argc - optind;
+
 	/* Make sure the user called our program correctly. */
-	if (argc != 3) {
-		perror("INCORRECT USAGE!\n");
+	if ((num_args != 2 && num_args != 3) || options.backlog <= 0 || options.fastopen_qlen < 0) {
+		fprintf(stderr, "INCORRECT USAGE!\n");
 		exit(1);
 	}
 	/* Read the port number from the first command line argument. */
-	int port = std::stoi(argv[1]);
+	int port = std::stoi(args[0]);
+
+	/* 
+	 * The optional third argument picks how connections are handled: "coro"
+	 * (the default) runs a coroutine per connection on a single event loop,
+	 * "pool" hands them to a pool of worker threads.
+	 */
+	std::string mode = (num_args == 3) ? args[2] : "coro";
+	if (mode != "coro" && mode != "pool") {
+		fprintf(stderr, "INCORRECT USAGE!\n");
+		exit(1);
+	}
+
+	/* A client hanging up mid-response shouldn't kill the whole server. */
+	signal(SIGPIPE, SIG_IGN);
 
 	/* Create a socket and start listening for new connections on the
 	 * specified port. */
-	int server_sock = createSocketAndListen(port);
+	int server_sock = createSocketAndListen(port, options);
+
+	/* Set aside a file descriptor for when we run out (see shedConnection). */
+	reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
 
 	/* Now let's start accepting connections. */
-	acceptConnections(server_sock, argv[2]);
+	if (mode == "pool")
+		runPool(server_sock, options, args[1]);
+	else
+		runReactor(server_sock, options, args[1]);
 
 	close(server_sock);
 
 	return 0;
 }
 
-/**
- * Sends message over given socket, raising an exception if there was a problem
- * sending.
- *
- * @param socket_fd The socket to send data over.
- * @param data The data to send.
- * @param data_length Number of bytes of data to send.
- */
-void sendData(int socked_fd, const char *data, size_t data_length) {
-	int num_bytes_remaining = data_length;
-	int start_position = data_length - num_bytes_remaining;
-	while(num_bytes_remaining > 0) 
-	{
-		int num_bytes_sent = send(socked_fd, (data + start_position) , num_bytes_remaining, 0);
-		if (num_bytes_sent == -1) {
-			std::error_code ec(errno, std::generic_category());
-			throw std::system_error(ec, "send failed");
-		}
-		num_bytes_remaining -= num_bytes_sent; 
-		start_position = data_length - num_bytes_remaining;
-	}
-}
-
-/**
- * Receives message over given socket, raising an exception if there was an
- * error in receiving.
- *
- * @param socket_fd The socket to send data over.
- * @param dest The buffer where we will store the received data.
- * @param buff_size Number of bytes in the buffer.
- * @return The number of bytes received and written to the destination buffer.
- */
-int receiveData(int socked_fd, char *dest, size_t buff_size) {
-	int num_bytes_received = recv(socked_fd, dest, buff_size, 0);
-	if (num_bytes_received == -1) {
-		std::error_code ec(errno, std::generic_category());
-		throw std::system_error(ec, "recv failed");
-	}
-
-	return num_bytes_received;
-}
-
 /*
  * Function that gets the current date and time to display when we send
  * responses
@@ -150,12 +191,12 @@ std::string dateToString (void)
 }
 
 /*
- * A function to send a file not found html to the requester.
+ * A function to build the file not found html to send to the requester.
  *
- *@param client_sock - The client's sock file descriptor
  *@param httpTypeResponse - A string that contains the type of response that will be sent
+ *@return toReturn - the full 404 response message
  */
-void sendFileNotFound (const int client_sock, std::string httpTypeResponse)
+std::string fileNotFoundResponse (std::string httpTypeResponse)
 {
 	// Create 404 Return Message
 	std::string toReturn;
@@ -167,50 +208,35 @@ void sendFileNotFound (const int client_sock, std::string httpTypeResponse)
 	toReturn.append("\r\n\r\n");
 	toReturn.append("<html><head><title>Page Not Found</title></head><body>404 Not Found</body></html>");
 
-	// Copy to char array and send
-	char message [toReturn.length() + 1];
-	strcpy(message, toReturn.c_str());
-	sendData(client_sock, message, sizeof(message)); 
+	return toReturn;
 }
 
 /*
- * A function to send a 400 bad request message to the requester.
+ * A function to build the 400 bad request message to send to the requester.
  *
- * @param client_sock - The client's sock file descripter
+ *@return toReturn - the full 400 response message
  */
-void sendBadRequest (const int client_sock)
+std::string badRequestResponse (void)
 {
 	// Create 400 Return Message
 	std::string toReturn ("HTTP/1.1 400 Bad Request\r\nConnection: close\r\nDate: ");
 
 	// Insert Date 
 	toReturn.append(dateToString());
-	toReturn.append("\r\n");
+	toReturn.append("\r\n\r\n");
 
-	// Copy to char array and send
-	char message [toReturn.length() + 1];
-	strcpy(message, toReturn.c_str());
-	sendData(client_sock, message, sizeof(message)); 
-	
+	return toReturn;
 }
 
 /*
- * A function that sends a 200 OK message to the client. This function has two
- * different states:
- * 1. Takes in a vector and a vector size and a blank string as the fifth
- * parameter
- * 2. Takes in a string with a blank vector and a size of -1.
+ * A function that builds the header of a 200 OK message. The entity body is
+ * sent separately, right after the header.
  *
- * @param client_sock - The client's sock file descripter
- * @param size - Size of the vector being passed in.
- * @param path extention - the file type being passed into the function, only
- * applicable in the first state of the function, otherwise, it is assumed
- * that the type is html.
- * @param s - vector that contains the byte data of the file.
- * @param string content - When a vector is not passed in, a blank string is
- * used instead
+ * @param size - Size of the entity body in bytes.
+ * @param path extention - the file type of the entity body.
+ * @return toReturn - the 200 OK header, including the blank line ending it.
  */
-void sendOK (const int client_sock, int size, fs::path extension, std::vector<char> s, std::string content)
+std::string okHeader (size_t size, fs::path extension)
 {
 	// Create 200 Return Message
 	std::string toReturn ("HTTP/1.1 200 OK\r\nDate: ");
@@ -219,40 +245,14 @@ void sendOK (const int client_sock, int size, fs::path extension, std::vector<ch
 	toReturn.append(dateToString());
 	toReturn.append("\r\n");
 	toReturn.append("Content-Length: ");
-	if (size < 0)
-		toReturn.append(boost::lexical_cast<std::string>(content.length()));
-	else
-		toReturn.append(boost::lexical_cast<std::string>(s.size()));
+	toReturn.append(boost::lexical_cast<std::string>(size));
 	toReturn.append("\r\n");
 	toReturn.append("Content-Type: ");
 	std::string extension_string(extension.string());
 	toReturn.append(extension_string.substr(1));
 	toReturn.append("\r\n\r\n");
-	int  messageSize = toReturn.length() + 2 + size;
-	if (size < 0)
-		messageSize = toReturn.length() + 2 + content.length();
-
-	// Create 2 temporary buffers to hold message/entityBody
-	char message [toReturn.length()+1];
-	strcpy (message, toReturn.c_str());
 
-	// Create final message, attach both and send
-	char finalMessage[messageSize];
-	memcpy(finalMessage, message, toReturn.length());
-
-	if (size < 0)
-	{
-		char contentMessage[content.length() +1];
-		strcpy(contentMessage, content.c_str());
-		memcpy((finalMessage + toReturn.length()), contentMessage, content.length());
-		sendData(client_sock, finalMessage, messageSize);
-		return;
-	}
-
-	char entityBody[s.size() + 1];
-	std::copy(s.begin(), s.end(), entityBody);
-	memcpy((finalMessage + toReturn.length()), entityBody, s.size());
-	sendData(client_sock, finalMessage, messageSize); 	
+	return toReturn;
 }
 
 /*
@@ -313,38 +313,45 @@ int containsIndex(fs::path directory)
 
 /**
  * Receives a request from a connected HTTP client and sends back the
- * appropriate response.
+ * appropriate response. This is a coroutine: whenever the socket isn't ready
+ * it suspends, and the reactor resumes it later. With no reactor the calling
+ * thread waits instead, and the whole request is handled before this returns.
  *
- * @note After this function returns, client_sock will have been closed (i.e.
+ * @note After the coroutine finishes, client_sock will have been closed (i.e.
  * may not be used again).
  *
+ * @param reactor The event loop driving this connection, or NULL if it is
+ * being handled by a worker thread.
  * @param client_sock The client's socket file descriptor.
+ * @param parent_directory The directory out of which to serve files.
  */
-void handleClient(BoundedBuffer &buff, char * parent_directory) 
+Task handleClient(Reactor *reactor, int client_sock, char *parent_directory) 
 {
-	while (true) // We have this so the thread does not finish and die off
+	// Set when the requested path couldn't be looked up (e.g. too long)
+	bool bad_path = false;
+	try
 	{
-		// This is run within a thread. Get the client socket info from buffer
-		int client_sock = buff.getItem();
-
 		// Receive data from client
 		char response_buffer[bufferSize];
-		int response = receiveData(client_sock, response_buffer, sizeof(response_buffer));
-		if (response <= 0)
+		size_t response = co_await async_recv(reactor, client_sock, response_buffer, sizeof(response_buffer) - 1);
+		if (response == 0)
 		{
 			close(client_sock);
-			continue;
+			co_return;
 			//There was no data received
 		}
+		response_buffer[response] = '\0';
+
 		// Parse the client's request using a regular expression
-		std::regex regularExpression ("GET([ \t]+)/([a-zA-Z0-9_\\-\\/.]*)([ \t]+)HTTP/([0-9]+).([0-9]+)([^]*)(Host:)*([^]*)",
+		static const std::regex regularExpression ("GET([ \t]+)/([a-zA-Z0-9_\\-\\/.]*)([ \t]+)HTTP/([0-9]+).([0-9]+)([^]*)(Host:)*([^]*)",
 				std::regex_constants::ECMAScript);
 		if (!regex_match(response_buffer, regularExpression)) 
 		{
 			// Request was bad, send 400 and return
-			sendBadRequest(client_sock);
+			std::string message = badRequestResponse();
+			co_await async_send(reactor, client_sock, message.data(), message.length());
 			close(client_sock);
-			continue;
+			co_return;
 		}
 
 		// Request was good, tokenize to get information from request
@@ -382,54 +389,103 @@ void handleClient(BoundedBuffer &buff, char * parent_directory)
 					// The path doesn't contain index.html. Generate HTML of directory and send
 					std::string html;
 					html = generateIndexHTML(p);
-					sendOK(client_sock, -1, ".html", std::vector<char>(), html);
+					std::string message = okHeader(html.length(), ".html") + html;
+					co_await async_send(reactor, client_sock, message.data(), message.length());
 					close(client_sock);
-					continue;
+					co_return;
 				}
 			}
 			if (fs::is_regular_file(p))
 			{
 				// The path is a file, send this file
-				fs::path d(fs::extension(p));
-
-				// Scan binary contents of file into vector
-				std::ifstream inFile;
-				inFile.open(p.string(), std::ios::binary|std::ios::in);
-				if (!inFile) 
+				int file_fd = open(p.string().c_str(), O_RDONLY | O_CLOEXEC);
+				struct stat file_info;
+				if (file_fd < 0 || fstat(file_fd, &file_info) < 0) 
 				{
+					if (file_fd >= 0)
+						close(file_fd);
 					close(client_sock);
-					continue;
+					co_return;
+				}
+
+				// Send the 200 OK header, then let the kernel copy the file
+				// straight to the socket
+				std::string message = okHeader(file_info.st_size, fs::extension(p));
+				try
+				{
+					co_await async_send(reactor, client_sock, message.data(), message.length());
+					co_await async_sendfile(reactor, client_sock, file_fd, 0, file_info.st_size);
+				}
+				catch (const std::system_error &e)
+				{
+					close(file_fd);
+					throw;
 				}
-				inFile.seekg(0, std::ios::end);			
-				std::streampos position = inFile.tellg();
-				inFile.seekg(0, std::ios::beg);
-				std::vector<char> buffer((std::istreambuf_iterator<char>(inFile)), std::istreambuf_iterator<char>());
-				int passPosition = (int)position;
-				inFile.close();
-
-				// Append file to 200 OK Message and send
-				sendOK(client_sock, passPosition, fs::extension(p), buffer, std::string());
-				close(client_sock);
+				close(file_fd);
 			}	
 		}
 		else 
 		{
 			// Not a file or directory, send 404 message
-			sendFileNotFound(client_sock, httpType_string);
-			close(client_sock);
+			std::string message = fileNotFoundResponse(httpType_string);
+			co_await async_send(reactor, client_sock, message.data(), message.length());
+		}
+	}
+	catch (const fs::filesystem_error &e)
+	{
+		// Nothing has been sent yet; treat it like a missing file below.
+		bad_path = true;
+	}
+	catch (const std::exception &e)
+	{
+		// The client went away (or misbehaved); just drop the connection.
+		std::cerr << "Error handling client: " << e.what() << "\n";
+	}
+
+	if (bad_path)
+	{
+		try
+		{
+			std::string message = fileNotFoundResponse("HTTP/1.1");
+			co_await async_send(reactor, client_sock, message.data(), message.length());
+		}
+		catch (const std::exception &e)
+		{
+			std::cerr << "Error handling client: " << e.what() << "\n";
 		}
 	}
+	close(client_sock);
+}
+
+/**
+ * Worker thread for the thread pool: takes accepted connections off the
+ * buffer and handles them one at a time, forever.
+ *
+ * @param buff The buffer of accepted client sockets.
+ * @param parent_directory The directory out of which to serve files.
+ */
+void handleClients(BoundedBuffer &buff, char *parent_directory)
+{
+	while (true) // We have this so the thread does not finish and die off
+	{
+		// This is run within a thread. Get the client socket info from buffer
+		int client_sock = buff.getItem();
+
+		// No reactor, so this runs the whole request before returning
+		handleClient(NULL, client_sock, parent_directory);
+	}
 }
 
 /**
- * Creates a new socket and starts listening on that socket for new
- * connections.
+ * Creates a new (non-blocking) socket and starts listening on that socket for
+ * new connections.
  *
  * @param port_num The port number on which to listen for connections.
+ * @param options Tunables for the listening socket.
  * @returns The socket file descriptor
  */
-int createSocketAndListen(const int port_num) {
-	int sock = socket(AF_INET, SOCK_STREAM, 0);
+int createSocketAndListen(const int port_num, const ListenOptions &options) {
+	int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 	if (sock < 0) {
 		perror("Creating socket failed");
 		exit(1);
@@ -483,14 +539,40 @@ int createSocketAndListen(const int port_num) {
 		exit(1);
 	}
 
+	/*
+	 * With TCP_DEFER_ACCEPT the kernel doesn't report a connection as ready to
+	 * accept until the client has actually sent something, so we never tie
+	 * up a worker (or a coroutine) waiting on a silent client. It's only a
+	 * performance hint, so failing to set it isn't fatal.
+	 */
+	int defer_seconds = DEFER_ACCEPT_SECONDS;
+	retval = setsockopt(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_seconds,
+			sizeof(defer_seconds));
+	if (retval < 0) {
+		perror("Setting TCP_DEFER_ACCEPT failed");
+	}
+
+	/*
+	 * TCP_FASTOPEN lets returning clients send their request along with the
+	 * SYN, saving a round trip. The value is how many such connections may be
+	 * waiting on the handshake at once.
+	 */
+	if (options.fastopen_qlen > 0) {
+		int qlen = options.fastopen_qlen;
+		retval = setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen));
+		if (retval < 0) {
+			perror("Setting TCP_FASTOPEN failed");
+		}
+	}
+
 	/* 
 	 * Now that we've bound to an address and port, we tell the OS that we're
 	 * ready to start listening for client connections. This effectively
-	 * activates the server socket. BACKLOG (a global constant defined above)
-	 * tells the OS how much space to reserve for incoming connections that have
-	 * not yet been accepted.
+	 * activates the server socket. The backlog (DEFAULT_BACKLOG unless given
+	 * with -b) tells the OS how much space to reserve for incoming
+	 * connections that have not yet been accepted.
 	 */
-	retval = listen(sock, BACKLOG);
+	retval = listen(sock, options.backlog);
 	if (retval < 0) {
 		perror("Error listening for connections");
 		exit(1);
@@ -500,52 +582,158 @@ int createSocketAndListen(const int port_num) {
 }
 
 /**
- * Sit around forever accepting new connections from client.
+ * Called when accept fails because we are out of file descriptors. Rather
+ * than leaving the connection in the queue (where it would keep the
+ * listening socket readable and make us spin), give up our spare descriptor,
+ * use it to accept the connection and close it right away, then take the
+ * spare back.
  *
  * @param server_sock The socket used by the server.
+ * @return true if a connection was dropped, false if there was no spare
+ * descriptor or no connection waiting. (accept returns EMFILE even when the
+ * queue is empty, so the caller must back off rather than retry right away.)
  */
-void acceptConnections(const int server_sock, char *parent_directory) 
+bool shedConnection(const int server_sock)
 {
-	BoundedBuffer buffer(bufferSize);
-	for (size_t i = 0; i < BACKLOG; i++)
+	if (reserve_fd < 0)
 	{
-		std::thread clientThread(handleClient, std::ref(buffer), std::ref(parent_directory));
-		clientThread.detach();
+		reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+		if (reserve_fd < 0)
+			return false;
 	}
-	while (true) 
+	close(reserve_fd);
+	int sock = accept4(server_sock, NULL, NULL, SOCK_CLOEXEC);
+	if (sock >= 0)
+		close(sock);
+
+	// In pool mode a worker thread may grab the slot we just freed before we
+	// get it back, leaving us without a spare until descriptors free up.
+	reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	if (reserve_fd < 0)
+		perror("Error reopening reserve file descriptor");
+
+	return sock >= 0;
+}
+
+/**
+ * Coroutine that sits around forever accepting new connections from clients.
+ * Each wake-up drains up to ACCEPT_BATCH waiting connections. With a buffer
+ * the connections are handed to the worker threads; otherwise a handleClient
+ * coroutine is started for each one on the same reactor, and the next batch
+ * waits until the reactor has given every other ready connection a turn.
+ *
+ * @param reactor The event loop that drives every connection, or NULL to
+ * wait on this thread.
+ * @param buffer The worker threads' buffer, or NULL to handle connections on
+ * the reactor.
+ * @param server_sock The (non-blocking) socket used by the server.
+ * @param options Tunables for the accepted connections.
+ * @param parent_directory The directory out of which to serve files.
+ */
+Task acceptConnections(Reactor *reactor, BoundedBuffer *buffer, const int server_sock, ListenOptions options, char *parent_directory)
+{
+	// Connections dropped in a row since we last let other coroutines run
+	size_t num_shed = 0;
+	while (true)
 	{
-		// Declare a socket for the client connection.
-		int sock;
-
-		/* 
-		 * Another address structure.  This time, the system will automatically
-		 * fill it in, when we accept a connection, to tell us where the
-		 * connection came from.
-		 */
-		struct sockaddr_in remote_addr;
-		unsigned int socklen = sizeof(remote_addr); 
-		/* 
-		 * Accept the first waiting connection from the server socket and
-		 * populate the address information.  The result (sock) is a socket
-		 * descriptor for the conversation with the newly connected client.  If
-		 * there are no pending connections in the back log, this function will
-		 * block indefinitely while waiting for a client connection to be made.
-		 */
-		sock = accept(server_sock, (struct sockaddr*) &remote_addr, &socklen);
-		if (sock < 0) {
-			perror("Error accepting connection");
-			exit(1);
+		std::vector<int> socks;
+		bool back_off = false;
+		try
+		{
+			socks = co_await async_accept(reactor, server_sock, ACCEPT_BATCH);
+		}
+		catch (const std::system_error &e)
+		{
+			switch (e.code().value()) {
+				case EMFILE:
+				case ENFILE:
+					// Out of descriptors: drop a connection so we can recover.
+					// Every so often, pause so the connections holding the
+					// descriptors get a chance to finish and close them.
+					if (shedConnection(server_sock) && ++num_shed < ACCEPT_BATCH)
+						break;
+					num_shed = 0;
+					back_off = true;
+					break;
+				case ENOBUFS:
+				case ENOMEM:
+					// Out of kernel memory: give it a moment.
+					back_off = true;
+					break;
+				case ECONNABORTED:
+				case EPROTO:
+				case EPERM:
+				case ENETDOWN:
+				case ENOPROTOOPT:
+				case EHOSTDOWN:
+				case ENONET:
+				case EHOSTUNREACH:
+				case EOPNOTSUPP:
+				case ENETUNREACH:
+					// The client's problem, not ours (see accept(2)).
+					break;
+				default:
+					std::cerr << "Error accepting connection: " << e.what() << "\n";
+					exit(1);
+			}
+		}
+		if (back_off)
+			co_await sleep_for(reactor, ACCEPT_BACKOFF);
+		if (!socks.empty())
+			num_shed = 0;
+
+		for (int sock : socks)
+		{
+			if (options.nodelay) {
+				int nodelay_true = 1;
+				setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay_true, sizeof(nodelay_true));
+			}
+
+			/* 
+			 * At this point, you have a connected socket (named sock) that you
+			 * can use to send() and recv(). The handleClient function should
+			 * handle all of the sending and receiving to/from the client.
+			 */
+			if (buffer != NULL)
+				buffer->putItem(sock);
+			else
+				handleClient(reactor, sock, parent_directory); // runs until it first has to wait
 		}
-		/* 
-		 * At this point, you have a connected socket (named sock) that you can
-		 * use to send() and recv(). The handleClient function should handle all
-		 * of the sending and receiving to/from the client.
-		 */
-		buffer.putItem(sock);
-
-		/* 
-		 * Tell the OS to clean up the resources associated with that client
-		 * connection, now that we're done with it.
-		 */
 	}
 }
+
+/**
+ * Runs the thread pool version of the server: this thread accepts
+ * connections and NUM_WORKERS threads handle them.
+ *
+ * @param server_sock The socket used by the server.
+ * @param options Tunables for the accepted connections.
+ * @param parent_directory The directory out of which to serve files.
+ */
+void runPool(const int server_sock, const ListenOptions &options, char *parent_directory) 
+{
+	BoundedBuffer buffer(bufferSize);
+	for (int i = 0; i < NUM_WORKERS; i++)
+	{
+		std::thread clientThread(handleClients, std::ref(buffer), parent_directory);
+		clientThread.detach();
+	}
+
+	// No reactor, so this never returns.
+	acceptConnections(NULL, &buffer, server_sock, options, parent_directory);
+}
+
+/**
+ * Runs the event loop version of the server: one thread, one coroutine per
+ * connection.
+ *
+ * @param server_sock The socket used by the server.
+ * @param options Tunables for the accepted connections.
+ * @param parent_directory The directory out of which to serve files.
+ */
+void runReactor(const int server_sock, const ListenOptions &options, char *parent_directory)
+{
+	Reactor reactor;
+	acceptConnections(&reactor, NULL, server_sock, options, parent_directory);
+	reactor.run();
+}